@@ -0,0 +1,48 @@
+// alloc_count.cpp : Replaces the global operator new/delete with counting versions.
+// Only operator new is counted; malloc calls made directly by the CRT are not.
+//
+
+#include "alloc_count.h"
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+namespace
+{
+	std::atomic<size_t> g_allocations(0);
+	std::atomic<size_t> g_bytes(0);
+
+	void *counted_alloc(size_t size)
+	{
+		++g_allocations;
+		g_bytes += size;
+		return malloc(size ? size : 1);
+	}
+}
+
+size_t alloc_count::allocations() { return g_allocations; }
+size_t alloc_count::bytes() { return g_bytes; }
+
+void *operator new(size_t size)
+{
+	void *p = counted_alloc(size);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new[](size_t size)
+{
+	void *p = counted_alloc(size);
+	if(!p)
+		throw std::bad_alloc();
+	return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t&) throw() { return counted_alloc(size); }
+void *operator new[](size_t size, const std::nothrow_t&) throw() { return counted_alloc(size); }
+
+void operator delete(void *p) throw() { free(p); }
+void operator delete[](void *p) throw() { free(p); }
+void operator delete(void *p, const std::nothrow_t&) throw() { free(p); }
+void operator delete[](void *p, const std::nothrow_t&) throw() { free(p); }
@@ -0,0 +1,15 @@
+// alloc_count.h : Counting replacements of the global operator new/delete.
+// Link alloc_count.cpp into a program to count every heap allocation it makes.
+//
+
+#pragma once
+
+#include <cstddef>
+
+namespace alloc_count
+{
+	// Number of operator new calls so far.
+	size_t allocations();
+	// Total bytes requested from operator new so far.
+	size_t bytes();
+}
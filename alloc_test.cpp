@@ -0,0 +1,53 @@
+// alloc_test.cpp : Checks how many heap allocations mini::format makes.
+// Formatting into an output that is already big enough must not allocate.
+//
+
+#include "stdafx.h"
+#include "miniformat_va.h"
+#include "alloc_count.h"
+#include <string>
+
+template <typename String, typename... TS>
+size_t allocations_of(String& str, const char *formatText, TS... args)
+{
+	size_t before = alloc_count::allocations();
+	mini::format(str, formatText, args...);
+	return alloc_count::allocations() - before;
+}
+
+void test_alloc()
+{
+	// std::string reserved up front.
+	{
+		std::string str;
+		str.reserve(256);
+		assert(allocations_of(str, "%0\n", 7) == 0);
+		assert(allocations_of(str, "%0 %1 %(.3)2\n", 100, "JJ", 3.141592) == 0);
+		assert(allocations_of(str, "%(6)0 %(6.2)1\n", int64_t(-100), -3.14) == 0);
+		assert(allocations_of(str, "%(.3)0\n", mini::timestamp(1369125015123456LL)) == 0);
+		assert(str == "2013-05-21T08:30:15.123Z\n");
+		const mini::compiled_format& fmt = mini::intern("%1 %0 %(.3)2\n");
+		size_t before = alloc_count::allocations();
+		mini::format(str, fmt, 100, "JJ", 3.141592);
+		assert(alloc_count::allocations() == before);
+		assert(str == "JJ 100 3.142\n");
+	}
+
+	// std::string reused across calls: only the first call may allocate.
+	{
+		std::string str;
+		allocations_of(str, "%0 %1 %(.3)2\n", 100, "JJ", 3.141592);
+		assert(allocations_of(str, "%0 %1 %(.3)2\n", 100, "JJ", 3.141592) == 0);
+		assert(allocations_of(str, "%0 %1\n", uint32_t(42), uint64_t(42)) == 0);
+		assert(str == "42 42\n");
+	}
+
+	// Fixed-size char arrays never allocate.
+	{
+		char str[256] = "";
+		assert(allocations_of(str, "%0 %1 %(.3)2\n", 100, "JJ", 3.141592) == 0);
+		assert(strcmp(str, "100 JJ 3.142\n") == 0);
+		assert(allocations_of(str, "%0%1 %(6.2)2\n", -7, "x", -3.14) == 0);
+		assert(strcmp(str, "-7x  -3.14\n") == 0);
+	}
+}
@@ -0,0 +1,108 @@
+// bench.cpp : Micro benchmark for mini::format.
+// Reports the time and the number of heap allocations per operation for each case.
+// Not part of test_tinyformat; build it on its own with optimizations on, e.g.
+//    g++ -O2 -std=c++11 bench.cpp alloc_count.cpp -o bench
+//    cl /O2 /EHsc bench.cpp alloc_count.cpp
+// Usage: bench [iterations]
+//
+
+#include "miniformat_va.h"
+#include "alloc_count.h"
+#include <chrono>
+#include <cstdlib>
+#include <string>
+
+namespace
+{
+	volatile size_t g_sink;	// Keeps the optimizer from dropping the work.
+
+	template <typename Op>
+	void run(const char *name, int iterations, Op op)
+	{
+		op();	// Warm up, so that reused outputs reach their steady state.
+
+		size_t allocations = alloc_count::allocations();
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		for(int i = 0; i < iterations; ++i)
+			op();
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		allocations = alloc_count::allocations() - allocations;
+
+		double ns = std::chrono::duration<double, std::nano>(end - begin).count();
+		printf("%-32s %10.2f ns/op %8.3f allocs/op\n", name, ns / iterations, double(allocations) / iterations);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	const int iterations = argc > 1 ? atoi(argv[1]) : 1000000;
+
+	std::string reused;
+	char fixed[256] = "";
+
+	run("int, new string", iterations, [&]() {
+		std::string str;
+		mini::format(str, "%0\n", 123456);
+		g_sink = str.length();
+	});
+	run("int, reused string", iterations, [&]() {
+		mini::format(reused, "%0\n", 123456);
+		g_sink = reused.length();
+	});
+	run("int, char[256]", iterations, [&]() {
+		mini::format(fixed, "%0\n", 123456);
+		g_sink = fixed[0];
+	});
+	run("double, reused string", iterations, [&]() {
+		mini::format(reused, "%(.3)0\n", 3.141592);
+		g_sink = reused.length();
+	});
+	// The one-digit specifiers have their own fast path; the others go through detail::parse_spec.
+	run("plain %0 %1, reused string", iterations, [&]() {
+		mini::format(reused, "id=%0 v=%1\n", 12345, "abc");
+		g_sink = reused.length();
+	});
+	run("spec %(6.2)0 %(8)1, reused string", iterations, [&]() {
+		mini::format(reused, "%(6.2)0 %(8)1\n", 3.14, 12345);
+		g_sink = reused.length();
+	});
+	run("spec %(6.2)0, reused string", iterations, [&]() {
+		mini::format(reused, "%(6.2)0\n", 3.14);
+		g_sink = reused.length();
+	});
+	run("spec %(12.2)0, reused string", iterations, [&]() {
+		mini::format(reused, "%(12.2)0\n", 3.14);
+		g_sink = reused.length();
+	});
+	run("spec %(*.*)2, reused string", iterations, [&]() {
+		mini::format(reused, "%(*.*)2\n", 6, 2, 3.14);
+		g_sink = reused.length();
+	});
+	run("mixed, new string", iterations, [&]() {
+		std::string str;
+		mini::format(str, "String: %0 Int: %1, Float: %(.3)2\n", "JJ", 100, 3.141592);
+		g_sink = str.length();
+	});
+	run("mixed, reused string", iterations, [&]() {
+		mini::format(reused, "String: %0 Int: %1, Float: %(.3)2\n", "JJ", 100, 3.141592);
+		g_sink = reused.length();
+	});
+	run("mixed, interned, reused string", iterations, [&]() {
+		static const mini::compiled_format& fmt = mini::intern("String: %0 Int: %1, Float: %(.3)2\n");
+		mini::format(reused, fmt, "JJ", 100, 3.141592);
+		g_sink = reused.length();
+	});
+	run("mixed, char[256]", iterations, [&]() {
+		mini::format(fixed, "String: %0 Int: %1, Float: %(.3)2\n", "JJ", 100, 3.141592);
+		g_sink = fixed[0];
+	});
+	run("mixed, snprintf", iterations, [&]() {
+		g_sink = snprintf(fixed, sizeof(fixed), "String: %s Int: %d, Float: %.3f\n", "JJ", 100, 3.141592);
+	});
+	run("timestamp, reused string", iterations, [&]() {
+		mini::format(reused, "%(.3)0 ", mini::timestamp(1369125015123456LL));
+		g_sink = reused.length();
+	});
+
+	return 0;
+}
@@ -3,8 +3,11 @@
 
 #include "stdafx.h"
 #include "miniformat_va.h"
+#include "miniformat_mmap.h"
 #include <string>
 #include <vector>
+#include <list>
+#include <thread>
 
 template <typename T>
 void test()
@@ -52,14 +55,316 @@ void test()
 	assert(std::string(str) == "  3.14\n");
 	mini::format(str, "%(6.2)0\n", -3.14);
 	assert(std::string(str) == " -3.14\n");
-	// Followings should assert in debug.
+	mini::format(str, "%0\n", mini::timestamp(1369125015123456LL));
+	assert(std::string(str) == "2013-05-21T08:30:15.123456Z\n");
+	mini::format(str, "%(.3)0\n", mini::timestamp(1369125015123456LL));
+	assert(std::string(str) == "2013-05-21T08:30:15.123Z\n");
+	mini::format(str, "%(.0)0\n", mini::timestamp(1369125075000001LL));
+	assert(std::string(str) == "2013-05-21T08:31:15Z\n");
+	mini::format(str, "%(.3)0\n", mini::timestamp(-1000LL));
+	assert(std::string(str) == "1969-12-31T23:59:59.999Z\n");
+	mini::format(str, "%(.1)0\n", -1.95);
+	assert(std::string(str) == "-2.0\n");
+	mini::format(str, "%(.0)0 %(.0)1 %(.0)2 %(.0)3 %(.0)4\n", 0.5, 1.5, 2.5, -2.5, 4.5);
+	assert(std::string(str) == "0 2 2 -2 4\n");
+	mini::format(str, "%(.0)0 %(.0)1\n", 1.6, -0.4);
+	assert(std::string(str) == "2 -0\n");
+	mini::format(str, "%(12)0|\n", 100);
+	assert(std::string(str) == "         100|\n");
+	mini::format(str, "%(10.12)0\n", 0.5);
+	assert(std::string(str) == "0.500000000\n");
+	mini::format(str, "%0 %1 %2 %3 %4 %5 %6 %7 %8 %9 %10 %11\n", 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11);
+	assert(std::string(str) == "0 1 2 3 4 5 6 7 8 9 10 11\n");
+	mini::format(str, "[%(*)1]\n", 5, 42);
+	assert(std::string(str) == "[   42]\n");
+	mini::format(str, "[%(*.*)2] [%(.*)4]\n", 8, 2, 3.14159, 1, 2.5);
+	assert(std::string(str) == "[    3.14] [2.5]\n");
+	// Widths and precisions from arguments are held to the same limit as literal ones.
+	mini::format(str, "%(*)1|", 100000, 5);
+	assert(std::string(str).length() == 9999 + 1);
+	mini::format(str, "[%(*.*)2]\n", -3, uint64_t(-1), 1);
+	assert(std::string(str) == "[1]\n");
+
 	//mini::format(std::string(str), "%0 %n\n", 3);
 	//mini::format(std::string(str), "%(.3)1\n", 3.141592);
 	//mini::format(std::string(str), "String: %1 Int: %0, Float: %(.3)3\n", 100, "JJ", 3.141592);
 }
+void test_join()
+{
+	std::string str;
+	std::vector<int> ids;
+	for(int i = 1; i <= 5; ++i)
+		ids.push_back(i * 100);
+	mini::format(str, "ids: %0\n", mini::join(ids, ", "));
+	assert(str == "ids: 100, 200, 300, 400, 500\n");
+	const double values[] = { 3.141592, -2.5, 10 };
+	mini::format(str, "[%0] n=%1\n", mini::join(values, " ", "%(.3)0"), 3);
+	assert(str == "[3.142 -2.500 10.000] n=3\n");
+	const char *names[] = { "one", "two" };
+	mini::format(str, "%0\n", mini::join(names, ",", "<%0>"));
+	assert(str == "<one>,<two>\n");
+	std::list<int> sorted(ids.begin(), ids.end());	// Not sized up front
+	mini::format(str, "%0\n", mini::join(sorted, "-"));
+	assert(str == "100-200-300-400-500\n");
+	mini::format(str, "[%(10.1)0]\n", mini::join(names, ","));	// Outer options are ignored
+	assert(str == "[one,two]\n");
+	mini::format(str, "(%0)\n", mini::join(std::vector<int>(), ", "));
+	assert(str == "()\n");
+	char fixed[64] = "";
+	mini::format(fixed, "%0;\n", mini::join(ids, "|"));
+	assert(std::string(fixed) == "100|200|300|400|500;\n");
+
+	// Streaming into a sink in chunks of at least 16 bytes, cut only between elements.
+	std::vector<std::string> chunks;
+	auto sink = [&chunks](const char *data, int size) { chunks.push_back(std::string(data, size)); };
+	{
+		mini::chunked_output<decltype(sink), 16> out(sink);
+		std::vector<int> many(20, 12345);
+		mini::format(out, "%0\n", mini::join(many, ","));
+	}
+	std::string joined;
+	for(size_t i = 0; i < chunks.size(); ++i)
+	{
+		assert(chunks[i].length() >= 16 || i+1 == chunks.size());
+		joined += chunks[i];
+	}
+	assert(chunks.size() > 1);
+	assert(joined.length() == 20*6);
+	assert(joined.compare(0, 12, "12345,12345,") == 0);
+
+	// Row by row, the text of several format calls is gathered into one chunk.
+	chunks.clear();
+	{
+		mini::chunked_output<decltype(sink), 16> out(sink);
+		for(int i = 0; i < 10; ++i)
+			mini::format(out, "row %0\n", i);
+	}
+	assert(chunks.size() == 4);
+	assert(chunks[0] == "row 0\nrow 1\nrow 2\n");
+	assert(chunks[3] == "row 9\n");
+
+	// The reservation for a huge join saturates instead of overflowing.
+	const std::vector<char> huge(mini::detail::kMaxJoinReservation / (mini::detail::kGranulity + 4) + 1, 'x');
+	assert(mini::detail::size_enough(mini::join(huge, ", ")) == mini::detail::kMaxJoinReservation);
+
+	// The text is flushed once, by the output returned from chunked(), never by a copy.
+	chunks.clear();
+	{
+		auto out = mini::chunked(sink);
+		mini::format(out, "%0 %1\n", "moved", 1);
+	}
+	assert(chunks.size() == 1 && chunks[0] == "moved 1\n");
+}
+
+void test_intern()
+{
+	std::string str;
+	const mini::compiled_format& fmt = mini::intern("String: %1 Int: %0, Float: %(.3)2\n");
+	assert(fmt.valid() && fmt.argument_count() == 3);
+	mini::format(str, fmt, 100, "JJ", 3.141592);
+	assert(str == "String: JJ Int: 100, Float: 3.142\n");
+	mini::format(str, mini::intern("%1 %1 %1\n"), 100, "JJ", 3.141592);
+	assert(str == "JJ JJ JJ\n");
+	mini::format(str, mini::intern("%(.2)2 %(.3)2 %(.4)2\n"), 100, "JJ", 3.141592);
+	assert(str == "3.14 3.142 3.1416\n");
+	mini::format(str, mini::intern("%2 %1 %0 %0 %1 %2\n"), 100, "JJ", 3.141592);
+	assert(str == "3.141592 JJ 100 100 JJ 3.141592\n");
+	mini::format(str, mini::intern("%0 %%, %%0\n"), "Literal");
+	assert(str == "Literal %, %0\n");
+	mini::format(str, mini::intern("%11|%(12)10|%(*.*)2\n"), 8, 2, 3.14159, 3, 4, 5, 6, 7, 8, 9, "ten", "eleven");
+	assert(str == "eleven|         ten|    3.14\n");
+	mini::format(str, mini::intern("%(*)1|"), int64_t(2000000000), 5);
+	assert(str.length() == 9999 + 1);
+	// Invalid specifiers from data don't assert; they are reported by valid() and kept as text.
+	const mini::compiled_format& invalid = mini::intern("50% done, %0 left\n");
+	assert(!invalid.valid());
+	mini::format(str, invalid, 3);
+	assert(str == "50% done, 3 left\n");
+	// Nor do references to arguments that aren't passed; those specifiers render nothing.
+	const mini::compiled_format& translated = mini::intern("%0 of %3\n");
+	assert(translated.valid() && translated.argument_count() == 4);
+	mini::format(str, translated, 1, 2, 3);
+	assert(str == "1 of \n");
+	// Numbers too large for a width, precision or index are invalid rather than overflowing.
+	assert(!mini::intern("%(99999999999)0\n").valid());
+	assert(!mini::intern("%(.99999999999)0\n").valid());
+	assert(!mini::intern("%99999999999\n").valid());
+	mini::format(str, mini::intern("%(9999.2)0|%(10000)0\n"), 1.5);
+	assert(str.length() == 9999 + 11);
+	assert(str.compare(9999, 11, "|%(10000)0\n") == 0);
+	mini::format(str, mini::intern("no arguments\n"));
+	assert(str == "no arguments\n");
+
+	// Interned by content.
+	char buffer[32];
+	strcpy(buffer, "%1 %1 %1\n");
+	assert(&mini::intern(buffer) == &mini::intern("%1 %1 %1\n"));
+	assert(&mini::intern(buffer) != &fmt);
+
+	// Concurrent interning ends up with one compiled format per string.
+	const int kThreads = 4, kFormats = 200;
+	std::vector<const mini::compiled_format *> seen(kThreads * kFormats);
+	std::vector<std::thread> threads;
+	for(int t = 0; t < kThreads; ++t)
+	{
+		threads.push_back(std::thread([t, &seen]() {
+			std::string text;
+			for(int i = 0; i < kFormats; ++i)
+			{
+				mini::format(text, "thread test %0: %%0\n", i);
+				seen[t * kFormats + i] = &mini::intern(text.c_str());
+			}
+		}));
+	}
+	for(size_t t = 0; t < threads.size(); ++t)
+		threads[t].join();
+	for(int t = 1; t < kThreads; ++t)
+		for(int i = 0; i < kFormats; ++i)
+			assert(seen[t * kFormats + i] == seen[i]);
+}
+
+std::string read_file(const char *path)
+{
+	std::string text;
+	FILE *fp = fopen(path, "rb");
+	assert(fp);
+	char buffer[4096];
+	size_t read;
+	while((read = fread(buffer, 1, sizeof(buffer), fp)) > 0)
+		text.append(buffer, read);
+	fclose(fp);
+	return text;
+}
+
+void test_mmap()
+{
+	const char *path = "test_mmap_output.txt";
+	std::string expected;
+	{
+		mini::mmap_output out(path);
+		assert(out.is_open());
+		std::string line;
+		for(int i = 0; i < 1000; ++i)
+		{
+			mini::format(out, "%(6)0 %(.3)1 %2\n", i, i * 0.5, "row");
+			mini::format(line, "%(6)0 %(.3)1 %2\n", i, i * 0.5, "row");
+			expected += line;
+		}
+		assert(out.size() == static_cast<int64_t>(expected.length()));
+		assert(out.close());
+	}
+	assert(read_file(path) == expected);
+
+	// Small extents, so that the file grows, the window grows and the window is dropped
+	// many times. Some single rows are longer than an extent.
+	const int64_t kExtent = 64*1024;
+	expected.clear();
+	{
+		mini::mmap_output out(path, kExtent);
+		std::string line;
+		std::vector<int> wide(30000, 12345);
+		for(int i = 0; i < 20000; ++i)
+		{
+			if(i % 4000 == 0)
+			{
+				mini::format(out, "%0\n", mini::join(wide, ","));
+				mini::format(line, "%0\n", mini::join(wide, ","));
+			}
+			else
+			{
+				mini::format(out, "%(8)0 %(.3)1 %2\n", i, i * 0.25, "row");
+				mini::format(line, "%(8)0 %(.3)1 %2\n", i, i * 0.25, "row");
+			}
+			expected += line;
+		}
+		assert(!out.failed());
+		assert(out.size() == static_cast<int64_t>(expected.length()));
+		assert(out.size() > 10 * kExtent);
+	}
+	assert(read_file(path) == expected);
+	remove(path);
+
+	// I/O errors put the output in the failed state instead of crashing.
+	{
+		mini::mmap_output out("no_such_directory/test_mmap_output.txt");
+		assert(!out.is_open() && out.failed());
+		mini::format(out, "%0 %(.3)1 %2\n", 1, 3.14, "row");
+		assert(out.size() == 0);
+		assert(!out.close());
+	}
+}
+
+void test_table()
+{
+	std::string str;
+	mini::table t("  ");
+	t.left(0).precision(2, 3);
+	t.row("name", "count", "ratio");
+	t.row("alpha", 12, 0.5);
+	t.row("beta", -12345, 9.9996);
+	t.row(std::string("gamma"), uint64_t(7), -0.25);
+	t.render(str);
+	assert(str ==
+		"name    count   ratio\n"
+		"alpha      12   0.500\n"
+		"beta   -12345  10.000\n"
+		"gamma       7  -0.250\n");
+
+	mini::table times;
+	times.precision(1, 3).left(1);
+	times.row(1, mini::timestamp(1369125015123456LL), "x");
+	times.row(100, "-", "y");
+	times.render(str);
+	assert(str ==
+		"  1 2013-05-21T08:30:15.123Z x\n"
+		"100 -                        y\n");
+}
+
+void test_alloc();
+
+#ifdef MINIFORMAT_ENABLE_STATS
+void test_stats()
+{
+	std::string str;
+	const char *fmt = "%0 %(.3)1\n";
+	mini::stats::reset();
+	for(int i = 0; i < 3; ++i)
+		mini::format(str, fmt, "value", 3.141592);
+	std::map<const char *, mini::stats::entry> entries = mini::stats::snapshot();
+	assert(entries.size() == 1);
+	const mini::stats::entry& e = entries[fmt];
+	assert(e.calls == 3);
+	assert(e.bytes == 3 * strlen("value 3.142\n"));
+	assert(e.underReserved == 0);
+
+	// Calls on other threads are merged in, including those of threads that have finished.
+	std::thread worker([fmt]() {
+		std::string local;
+		mini::format(local, fmt, "value", 3.141592);
+		mini::format(local, fmt, "value", 3.141592);
+	});
+	worker.join();
+	entries = mini::stats::snapshot();
+	assert(entries.size() == 1);
+	assert(entries[fmt].calls == 5);
+	assert(entries[fmt].bytes == 5 * strlen("value 3.142\n"));
+	mini::stats::report(stdout);
+}
+#endif
+
 int _tmain(int argc, _TCHAR* argv[])
 {
 	test<std::string>();
+	test_join();
+	test_intern();
+	test_mmap();
+	test_table();
+#ifdef MINIFORMAT_ENABLE_STATS
+	test_stats();
+#else
+	// Statistics collection allocates on the first use of a format string.
+	test_alloc();
+#endif
 	system("pause");
 	return 0;
 }
@@ -0,0 +1,318 @@
+//////////////////////////////////////////////////////////////////////////
+//  File Name        : miniformat_mmap.h
+//  Description      : A memory-mapped file output for miniformat
+//    - Render functions write straight into the mapped pages of the file
+//    - Only a window of the file is mapped at a time, so memory use stays flat
+//      however big the file gets
+//    - The file grows in extents of a fixed size and is truncated to the exact length on close
+//    - I/O errors make the output fail(see failed()) rather than crash
+//////////////////////////////////////////////////////////////////////////
+
+#pragma  once
+
+#include "miniformat_va.h"
+
+#if defined(_WIN32)
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace miniformat
+{
+	// Each format call appends to the file: clear() commits what the previous call wrote
+	// and starts a new one at length 0, as with chunked_output.
+	// Provides the members the default string_adaptor functions use(reserve, capacity,
+	// append, length, operator[] and clear), so no adaptor overloads are needed.
+	// e.g.
+	//    mini::mmap_output out("report.txt");
+	//    for(...)
+	//        mini::format(out, "%0 %(12.3)1\n", name, value);
+	//    if(!out.close())
+	//        ...	// Some of the report could not be written.
+	// Once an open, resize or map fails, the output stays failed: further text is discarded,
+	// and only what was committed before the failure is kept in the file.
+	class mmap_output
+	{
+	public:
+		static const int64_t kDefaultExtent = 64*1024*1024;
+
+		// Creates or truncates the file at 'path'. 'extent' is the growth step of the file and
+		// the size of the mapped window. It must be a multiple of the page size
+		// (of the allocation granularity, 64KB, on Windows).
+		explicit mmap_output(const char *path, int64_t extent = kDefaultExtent);
+		~mmap_output() { close(); }
+
+		bool is_open() const;
+		// True once an I/O operation has failed.
+		bool failed() const { return failed_; }
+		// Unmaps the file and truncates it to the bytes written.
+		// Returns false if anything failed since the file was opened.
+		bool close();
+		// The number of bytes written to the file so far.
+		int64_t size() const { return failed_ ? base_ : base_ + length_; }
+
+		// For string_adaptor. Positions are relative to the start of the current format call.
+		void reserve(int size) { ensure(base_ + size); }
+		size_t capacity() const { return base_ < windowOffset_ + windowSize_ ? static_cast<size_t>(windowOffset_ + windowSize_ - base_) : 0; }
+		void append(const char *str) { append(str, static_cast<int>(strlen(str))); }
+		void append(const char *str, int count);
+		void append(int count, char c);
+		int length() const { return static_cast<int>(length_); }
+		char& operator[](int index) { return failed_ ? discarded_[index] : data_[base_ - windowOffset_ + index]; }
+		void clear();
+
+	private:
+		mmap_output(const mmap_output&);
+		mmap_output& operator=(const mmap_output&);
+
+		// Makes sure [0, end) of the file exists and [base_, end) is mapped.
+		// Returns false, and puts the output in the failed state, if it can't.
+		bool ensure(int64_t end);
+		// Moves the current format call into 'discarded_', so that the render functions
+		// can carry on writing somewhere.
+		void fail();
+		bool resize_file(int64_t size);
+		bool map_window(int64_t offset, int64_t size);
+		void unmap_window();
+
+#if defined(_WIN32)
+		HANDLE file_;
+		HANDLE mapping_;
+#else
+		int fd_;
+#endif
+		char *data_;
+		int64_t extent_;
+		int64_t windowOffset_;		// File offset of data_, a multiple of extent_
+		int64_t windowSize_;
+		int64_t fileSize_;
+		int64_t base_;				// File offset where the current format call started
+		int64_t length_;			// Bytes written by the current format call
+		bool failed_;
+		std::string discarded_;		// The current format call, once failed
+	};
+}
+
+inline void miniformat::mmap_output::append(const char *str, int count)
+{
+	if(ensure(base_ + length_ + count))
+		memcpy(data_ + (base_ - windowOffset_) + length_, str, count);
+	else
+		discarded_.append(str, count);
+	length_ += count;
+}
+
+inline void miniformat::mmap_output::append(int count, char c)
+{
+	if(ensure(base_ + length_ + count))
+		memset(data_ + (base_ - windowOffset_) + length_, c, count);
+	else
+		discarded_.append(count, c);
+	length_ += count;
+}
+
+inline void miniformat::mmap_output::clear()
+{
+	if(failed_)
+	{
+		discarded_.clear();
+		length_ = 0;
+		return;
+	}
+
+	base_ += length_;
+	length_ = 0;
+
+	// Drop the window once the committed part covers a whole extent, so that the written
+	// pages can leave memory. The next write maps a new one from here.
+	if(base_ - windowOffset_ >= extent_)
+	{
+		unmap_window();
+		windowOffset_ = base_ / extent_ * extent_;
+	}
+}
+
+inline bool miniformat::mmap_output::ensure(int64_t end)
+{
+	if(failed_)
+		return false;
+	if(end > fileSize_ && !resize_file((end + extent_ - 1) / extent_ * extent_))
+	{
+		fail();
+		return false;
+	}
+	if((!data_ || end > windowOffset_ + windowSize_) &&
+		!map_window(windowOffset_, (end - windowOffset_ + extent_ - 1) / extent_ * extent_))
+	{
+		fail();
+		return false;
+	}
+	return true;
+}
+
+inline void miniformat::mmap_output::fail()
+{
+	// The text of the current call may already be gone with the window, but only its
+	// positions matter to the render functions.
+	discarded_.assign(static_cast<size_t>(length_), ' ');
+	unmap_window();
+	failed_ = true;
+}
+
+#if defined(_WIN32)
+
+inline miniformat::mmap_output::mmap_output(const char *path, int64_t extent)
+	: mapping_(NULL), data_(NULL), extent_(extent), windowOffset_(0), windowSize_(0), fileSize_(0), base_(0), length_(0), failed_(false)
+{
+	file_ = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+	failed_ = file_ == INVALID_HANDLE_VALUE;
+}
+
+inline bool miniformat::mmap_output::is_open() const
+{
+	return file_ != INVALID_HANDLE_VALUE;
+}
+
+inline bool miniformat::mmap_output::close()
+{
+	if(!is_open())
+		return !failed_;
+	unmap_window();
+	if(mapping_)
+	{
+		CloseHandle(mapping_);
+		mapping_ = NULL;
+	}
+	LARGE_INTEGER end;
+	end.QuadPart = size();
+	if(!SetFilePointerEx(file_, end, NULL, FILE_BEGIN) || !SetEndOfFile(file_))
+		failed_ = true;
+	if(!CloseHandle(file_))
+		failed_ = true;
+	file_ = INVALID_HANDLE_VALUE;
+	return !failed_;
+}
+
+inline bool miniformat::mmap_output::resize_file(int64_t size)
+{
+	// A mapping object can't outgrow the size it was created with; map_window() recreates it.
+	unmap_window();
+	if(mapping_)
+	{
+		CloseHandle(mapping_);
+		mapping_ = NULL;
+	}
+	fileSize_ = size;
+	return true;
+}
+
+inline bool miniformat::mmap_output::map_window(int64_t offset, int64_t size)
+{
+	unmap_window();
+	if(!mapping_)
+	{
+		// Creating the mapping object extends the file to 'fileSize_'.
+		// It fails with ERROR_DISK_FULL if the space isn't there.
+		mapping_ = CreateFileMappingA(file_, NULL, PAGE_READWRITE,
+			static_cast<DWORD>(fileSize_ >> 32), static_cast<DWORD>(fileSize_), NULL);
+		if(!mapping_)
+			return false;
+	}
+	data_ = static_cast<char *>(MapViewOfFile(mapping_, FILE_MAP_WRITE,
+		static_cast<DWORD>(offset >> 32), static_cast<DWORD>(offset), static_cast<SIZE_T>(size)));
+	if(!data_)
+		return false;
+	windowOffset_ = offset;
+	windowSize_ = size;
+	return true;
+}
+
+inline void miniformat::mmap_output::unmap_window()
+{
+	if(data_)
+		UnmapViewOfFile(data_);
+	data_ = NULL;
+	windowSize_ = 0;
+}
+
+#else
+
+inline miniformat::mmap_output::mmap_output(const char *path, int64_t extent)
+	: data_(NULL), extent_(extent), windowOffset_(0), windowSize_(0), fileSize_(0), base_(0), length_(0), failed_(false)
+{
+	fd_ = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	failed_ = fd_ < 0;
+}
+
+inline bool miniformat::mmap_output::is_open() const
+{
+	return fd_ >= 0;
+}
+
+inline bool miniformat::mmap_output::close()
+{
+	if(!is_open())
+		return !failed_;
+	unmap_window();
+	if(ftruncate(fd_, static_cast<off_t>(size())) != 0)
+		failed_ = true;
+	if(::close(fd_) != 0)
+		failed_ = true;
+	fd_ = -1;
+	return !failed_;
+}
+
+inline bool miniformat::mmap_output::resize_file(int64_t size)
+{
+#if defined(__linux__)
+	// Allocate the blocks up front: writing to a sparse extent on a full disk would SIGBUS.
+	if(posix_fallocate(fd_, static_cast<off_t>(fileSize_), static_cast<off_t>(size - fileSize_)) != 0)
+		return false;
+#else
+	if(ftruncate(fd_, static_cast<off_t>(size)) != 0)
+		return false;
+#endif
+	fileSize_ = size;
+	return true;
+}
+
+inline bool miniformat::mmap_output::map_window(int64_t offset, int64_t size)
+{
+	void *p = MAP_FAILED;
+#if defined(__linux__)
+	if(data_ && offset == windowOffset_)
+	{
+		// Grow the current window in place, or move it without copying the pages.
+		p = mremap(data_, static_cast<size_t>(windowSize_), static_cast<size_t>(size), MREMAP_MAYMOVE);
+	}
+	else
+#endif
+	{
+		unmap_window();
+		p = mmap(NULL, static_cast<size_t>(size), PROT_READ | PROT_WRITE, MAP_SHARED, fd_, static_cast<off_t>(offset));
+	}
+	if(p == MAP_FAILED)
+	{
+		// A failed mremap leaves the old mapping in place.
+		unmap_window();
+		return false;
+	}
+	data_ = static_cast<char *>(p);
+	windowOffset_ = offset;
+	windowSize_ = size;
+	return true;
+}
+
+inline void miniformat::mmap_output::unmap_window()
+{
+	if(data_)
+		munmap(data_, static_cast<size_t>(windowSize_));
+	data_ = NULL;
+	windowSize_ = 0;
+}
+
+#endif
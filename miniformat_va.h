@@ -34,6 +34,19 @@
 #include <cassert>
 #include <cstdint>
 #include <cstring>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Define MINIFORMAT_ENABLE_STATS to collect per format string statistics(see miniformat::stats).
+#ifdef MINIFORMAT_ENABLE_STATS
+#include <map>
+#include <mutex>
+#endif
 
 #define _FORMAT_JOIN(x,y)		_FORMAT_JOIN2(x,y)
 #define _FORMAT_JOIN2(x,y)	x##y
@@ -64,6 +77,12 @@
 
 #define _FORMAT_ARG(cnt,P,p)		_FORMAT_JOIN(_FORMAT_ARG_,cnt)(P,p)
 
+#if defined(_MSC_VER) && _MSC_VER < 1900
+#define _FORMAT_THREAD_LOCAL	__declspec(thread)
+#else
+#define _FORMAT_THREAD_LOCAL	thread_local
+#endif
+
 namespace miniformat {}
 namespace mini = miniformat;
 
@@ -75,20 +94,300 @@ namespace miniformat
 	template<typename String,typename... TS>
 	void format(String& outputText, const char *formatText,TS... args);
 
-	template<typename... TS>
-	void format_va(TS... args);
+	namespace detail
+	{
+		struct pending_spec;
+	}
+
+	template<typename String>
+	int format_va(String& outputText, int currentLength, const char*& formatText, detail::pending_spec& pending);
 
 	template<typename String,typename T,typename... TS>
-	void format_va(String& outputText, const char*& formatText,T p1,TS... args);
+	int format_va(String& outputText, int currentLength, const char*& formatText, detail::pending_spec& pending,T p1,TS... args);
 
 	template<typename String,typename T>
-	int ApplyToFormatStr(String& outputText, const char *& itr,T p1);
+	int ApplyToFormatStr(String& outputText, int currentLength, const char *& itr, detail::pending_spec& pending,T p1);
+
+	class compiled_format;
+
+	// Renders a format string that has been parsed in advance(see intern()).
+	// Unlike the plain version, each specifier picks its argument by index,
+	// so arguments can be reordered and used more than once.
+	// A specifier whose argument isn't passed renders nothing. For format strings that come
+	// from data, compare compiled_format::argument_count() with the arguments to catch that.
+	template<typename String,typename... TS>
+	void format(String& outputText, const compiled_format& formatText,TS... args);
+
+	// Returns the compiled form of 'formatText', parsing and validating it on first use.
+	// Format strings are interned by content, so every thread shares the same compiled form.
+	// Thread-safe; looking up an already interned format takes no lock.
+	// Compiled formats are never freed.
+	const compiled_format& intern(const char *formatText);
+
+	// A point in time given as microseconds since 1970-01-01T00:00:00Z.
+	// Rendered as ISO-8601 UTC, e.g. "2013-05-21T08:30:15.123456Z".
+	// The precision option selects the number of sub-second digits(0~6, 6 by default),
+	// so "%(.3)0" gives milliseconds and "%(.0)0" whole seconds.
+	struct timestamp
+	{
+		explicit timestamp(int64_t usec) : microseconds(usec) {}
+		static timestamp now();
+
+		int64_t microseconds;
+	};
+
+	// Renders every element of [first, last) with 'elementFormat', separated by 'separator'.
+	// Made by mini::join(). The iterators must be forward iterators,
+	// and the range must outlive the format call.
+	// The width and precision of the outer specifier are ignored("%(10)0" is the same as "%0"),
+	// since the joined text may be flushed before its length is known. Put them in
+	// 'elementFormat' to apply them to each element.
+	template <typename Iterator>
+	struct join_view
+	{
+		Iterator first;
+		Iterator last;
+		const char *separator;
+		const char *elementFormat;
+	};
+
+	// e.g. mini::format(str, "ids: %0\n", mini::join(ids, ", ", "%(.3)0"));
+	template <typename Range>
+	join_view<typename Range::const_iterator> join(const Range& range, const char *separator, const char *elementFormat = "%0");
+	template <typename T, int N>
+	join_view<const T *> join(const T (&range)[N], const char *separator, const char *elementFormat = "%0");
+
+	// An output that hands its content over to a sink in chunks of about ChunkSize bytes,
+	// so that a huge output never has to be held in memory all at once.
+	// 'Sink' is any callable taking (const char *data, int size).
+	// Chunks are only cut between the elements of a join or between format calls, so a single
+	// argument is never split. Each format call starts from length 0, but the text of earlier
+	// calls stays buffered until a chunk is full.
+	// Lengths are int, as everywhere in miniformat, so a single format call is limited to 2GB
+	// even here; many calls into the same output are not.
+	template <typename Sink, int ChunkSize = 64*1024>
+	class chunked_output
+	{
+	public:
+		explicit chunked_output(Sink sink) : sink_(sink), base_(0), flushed_(0) {}
+		// Takes over the buffered text, which 'other' then no longer flushes.
+		chunked_output(chunked_output&& other)
+			: sink_(other.sink_), buffer_(std::move(other.buffer_)), base_(other.base_), flushed_(other.flushed_) { other.buffer_.clear(); }
+		~chunked_output() { flush(); }
+
+		// Hands the buffered text over to the sink.
+		void flush();
+
+		// For string_adaptor
+		void reserve(int size) { if(size > 0) buffer_.reserve(base_ + std::min(size, ChunkSize*2)); }
+		void append(const char *str) { buffer_.append(str); }
+		void append(const char *str, int count) { buffer_.append(str, count); }
+		void append(int count, char c) { buffer_.append(count, c); }
+		int length() const { return flushed_ + static_cast<int>(buffer_.length() - base_); }
+		char * at(int index) { return &buffer_[base_ + index - flushed_]; }
+		void clear() { checkpoint(); base_ = buffer_.length(); flushed_ = 0; }
+		void checkpoint() { if(static_cast<int>(buffer_.length()) >= ChunkSize) flush(); }
+
+	private:
+		// A copy would flush the same text a second time.
+		chunked_output(const chunked_output&);
+		chunked_output& operator=(const chunked_output&);
+
+		Sink sink_;
+		std::string buffer_;
+		size_t base_;		// Where the current format call starts in buffer_, if not flushed yet
+		int flushed_;		// Bytes of the current format call already flushed
+	};
+
+	template <typename Sink>
+	chunked_output<Sink> chunked(Sink sink) { return chunked_output<Sink>(sink); }
+
+	// A chunked_output sink writing to a FILE.
+	struct file_sink
+	{
+		explicit file_sink(FILE *fp) : fp(fp) {}
+		void operator()(const char *data, int size) const { fwrite(data, 1, size, fp); }
+
+		FILE *fp;
+	};
+
+	// Collects rows of cells and renders them as a text table,
+	// with every column padded to the width of its widest cell.
+	// The widths come from the sizing helpers(detail::width_of) rather than from formatting
+	// the cells twice, and the whole table is rendered into one exact-sized reservation.
+	// e.g.
+	//    mini::table t("  ");
+	//    t.left(0).precision(2, 3);
+	//    t.row("name", "count", "ratio");
+	//    t.row("alpha", 12, 0.5);
+	//    t.render(str);
+	class table
+	{
+	public:
+		explicit table(const char *separator = " ") : separator_(separator), columns_(0) {}
+
+		// Adds a row. Each argument is a cell: an integer, a double, a string or a timestamp.
+		template <typename... TS>
+		table& row(TS... cells);
+		// Left-aligns a column. Columns are right-aligned by default, as with "%(w)n".
+		table& left(int column);
+		// Sets the precision of the doubles and timestamps in a column(6 by default).
+		table& precision(int column, int precision);
+
+		int row_count() const { return static_cast<int>(rowEnds_.size()); }
+		int column_count() const { return columns_; }
+
+		// Renders the table into 'outputText', one line per row.
+		template <typename String>
+		void render(String& outputText) const;
+
+	private:
+		struct cell
+		{
+			enum type_t { kInt, kUInt, kDouble, kString, kTimestamp };
+
+			type_t type;
+			union
+			{
+				int64_t i;
+				uint64_t u;
+				double d;
+				int textBegin;		// Offset into text_. The length is in 'length'.
+			} value;
+			int length;
+		};
+
+		void add_cell(int32_t value) { add_cell(static_cast<int64_t>(value)); }
+		void add_cell(uint32_t value) { add_cell(static_cast<uint64_t>(value)); }
+		void add_cell(int64_t value);
+		void add_cell(uint64_t value);
+		void add_cell(double value);
+		void add_cell(const char *value);
+		void add_cell(const std::string& value) { add_cell(value.c_str()); }
+		void add_cell(timestamp value);
+		void ensure_column(int column);
+		int width_of(const cell& c, int column) const;
+
+		const char *separator_;
+		std::string text_;				// Text of the string cells
+		std::vector<cell> cells_;
+		std::vector<int> rowEnds_;		// Index into cells_ past the last cell of each row
+		std::vector<int> precisions_;
+		std::vector<char> lefts_;
+		int columns_;
+	};
+
+	// A single '%' specifier.
+	// Width and precision may be kFromArgument("%(*.*)n"). They are then taken from the arguments
+	// right before the value, i.e. index-2 and index-1, or index-1 if only one of them is dynamic.
+	struct format_spec
+	{
+		static const int kFromArgument = -1;
+		static const int kMaxNumber = 9999;	// Larger widths, precisions and indices are rejected.
+
+		int index;
+		int width;
+		int precision;
+	};
+
+	// A format string split into literal text and specifiers.
+	class compiled_format
+	{
+	public:
+		explicit compiled_format(const char *formatText);
+
+		const char *text() const { return text_.c_str(); }
+		// False if the format string had an invalid specifier. It is then rendered as literal text.
+		// Check this for format strings that come from data.
+		bool valid() const { return valid_; }
+		// The number of arguments the format string refers to.
+		int argument_count() const { return argumentCount_; }
+		// The total length of the literal text.
+		int literal_length() const { return static_cast<int>(literals_.length()); }
+
+		// Literal text followed by a specifier. The last segment has no specifier(index -1).
+		struct segment
+		{
+			int literalBegin;
+			int literalLength;
+			format_spec spec;
+			int widthIndex;			// The argument a kFromArgument width is taken from, or -1
+			int precisionIndex;		// Likewise for the precision
+		};
+		const std::vector<segment>& segments() const { return segments_; }
+		const char *literals() const { return literals_.data(); }
+
+	private:
+		std::string text_;
+		std::string literals_;	// "%%" already collapsed into '%'
+		std::vector<segment> segments_;
+		int argumentCount_;
+		bool valid_;
+	};
+
+#ifdef MINIFORMAT_ENABLE_STATS
+	// Per format string counters, keyed by the address of the format string.
+	// Meant for literal format strings: formats built at runtime in a reused buffer all land in
+	// one entry, shown with the text of the first of them, and a buffer freed and reallocated
+	// at the same address is merged with its predecessor.
+	// Only compiled in when MINIFORMAT_ENABLE_STATS is defined.
+	namespace stats
+	{
+		const int kSampleInterval = 64;	// Every n-th format call on a thread is timed.
+
+		struct entry
+		{
+			entry() : calls(0), bytes(0), reservedBytes(0), underReserved(0), sampledCalls(0), sampledNanoseconds(0) {}
+
+			std::string formatText;
+			uint64_t calls;
+			uint64_t bytes;				// Total output length
+			uint64_t reservedBytes;		// Total size given to string_adaptor::reserve
+			uint64_t underReserved;		// Calls whose output outgrew the reservation(a reallocation only if the capacity was short too)
+			uint64_t sampledCalls;
+			uint64_t sampledNanoseconds;
+		};
+
+		// Starts timing only if this call is picked as a sample.
+		class sample_timer
+		{
+		public:
+			sample_timer();
+			int64_t elapsed() const;	// -1 if not sampled
+		private:
+			bool sampled_;
+			std::chrono::steady_clock::time_point begin_;
+		};
+
+		void record(const char *formatText, size_t reserved, size_t length, int64_t nanoseconds);
+		// Returns the entries collected so far, merged over all the threads.
+		std::map<const char *, entry> snapshot();
+		void reset();
+		// Writes one line per format string, sorted by total output bytes.
+		// Columns: calls, total bytes, average bytes, average reservation, under-reserved calls
+		// and average nanoseconds of the sampled calls.
+		void report(FILE *fp);
+
+		// Each thread records into its own table, so formatting threads don't wait on each other.
+		// The tables live as long as the process, which keeps the counts of finished threads.
+		struct thread_table
+		{
+			std::mutex lock;	// Only ever contended by snapshot() and reset()
+			std::map<const char *, entry> entries;
+		};
+		thread_table& local_table();
+		std::mutex& registry_lock();
+		std::vector<thread_table *>& registry();
+	}
+#endif
 
 	namespace string_adaptor
 	{
         // Function overloads for std::string and similiars 
 		template <typename String>
-		void reserve(String& self, int size) { self.reserve(size); }
+		int length(const String& self) { return static_cast<int>(self.length()); }
+		template <typename String>
+		void reserve(String& self, int size) { if(static_cast<size_t>(size) > self.capacity()) self.reserve(size); }
 		template <typename String>
 		int append(String& self, int, const char *str) { self.append(str); return length(self); }
 		template <typename String>
@@ -96,14 +395,19 @@ namespace miniformat
 		template <typename String>
 		int append(String& self, int, int count, char c) { self.append(count, c); return length(self); }
 		template <typename String>
-		int length(const String& self) { return static_cast<int>(self.length()); }
-		template <typename String>
 		char * at(String& self, int index) { return &self[index]; }
         template <typename String>
         void copy(String& self, const char *str) { self = str; }
+        template <typename String>
+        void clear(String& self) { self.clear(); }
+        // Called between the elements of a join. Outputs may flush at this point.
+        template <typename String>
+        void checkpoint(String& self) {}
 
         // Function overloads for fixed-size char arrays
 		template <int N>
+        int length(const char (&self)[N]) { return static_cast<int>(strlen(self)); }
+		template <int N>
 		void reserve(char (&self)[N], int size) {}
 		template <int N>
 		int append(char (&self)[N], int currentLength, const char *str)
@@ -149,8 +453,6 @@ namespace miniformat
             return currentLength;
         }
 		template <int N>
-        int length(const char (&self)[N]) { return static_cast<int>(strlen(self)); }
-		template <int N>
 		char * at(char (&self)[N], int index)
         {
             assert(index<N);
@@ -165,11 +467,32 @@ namespace miniformat
             strlcpy(self, str, N-1);
 #endif
         }
+		template <int N>
+        void clear(char (&self)[N]) { self[0] = 0; }
+
+        // Function overloads for chunked_output
+		template <typename Sink, int N>
+		void reserve(chunked_output<Sink, N>& self, int size) { self.reserve(size); }
+		template <typename Sink, int N>
+		int append(chunked_output<Sink, N>& self, int, const char *str) { self.append(str); return self.length(); }
+		template <typename Sink, int N>
+		int append(chunked_output<Sink, N>& self, int, const char *str, int count) { self.append(str, count); return self.length(); }
+		template <typename Sink, int N>
+		int append(chunked_output<Sink, N>& self, int, int count, char c) { self.append(count, c); return self.length(); }
+		template <typename Sink, int N>
+		int length(const chunked_output<Sink, N>& self) { return self.length(); }
+		template <typename Sink, int N>
+		char * at(chunked_output<Sink, N>& self, int index) { return self.at(index); }
+		template <typename Sink, int N>
+		void clear(chunked_output<Sink, N>& self) { self.clear(); }
+		template <typename Sink, int N>
+		void checkpoint(chunked_output<Sink, N>& self) { self.checkpoint(); }
 	}
 
 	namespace detail
 	{
 		const int kGranulity = 32;	// This determines the reservation size for non-string arguments.
+		const int kMaxJoinReservation = 64*1024*1024;	// Larger joins grow as they are rendered.
 		static const double pow10[] = { 1, 10, 100, 1000, 10000, 100000, 1000000,
 																		10000000, 100000000, 1000000000 };
         // Integer render functions are inspired(optimized) from this: 
@@ -189,41 +512,117 @@ namespace miniformat
 		int render(String& wstr, int currentLength,  double value, int width, int precision);
 		template <typename String>
 		int render(String& wstr, int currentLength,  const char *value, int width, int precision);
+		template <typename String>
+		int render(String& wstr, int currentLength,  timestamp value, int width, int precision);
+		// Returns "YYYY-MM-DDTHH:MM:" for the given minutes since the epoch.
+		// The last result is cached per thread, so consecutive timestamps only pay for the seconds.
+		const char *timestamp_prefix(int64_t minutes);
+		template <typename String, typename Iterator>
+		int render(String& wstr, int currentLength,  const join_view<Iterator>& value, int width, int precision);
 		template <typename T>
 		int size_enough(T value);
         template <>
         int size_enough(const char *value);
+		// An estimate from the element count, so the range isn't walked twice. Only random access
+		// ranges are counted; for the others the output grows as the elements are rendered.
+		template <typename Iterator>
+		int size_enough(const join_view<Iterator>& value);
+		template <typename Iterator>
+		size_t join_element_count(Iterator first, Iterator last, std::random_access_iterator_tag);
+		template <typename Iterator, typename Category>
+		size_t join_element_count(Iterator first, Iterator last, Category);
 		void strreverse(char *begin, char *end);
+
+		// Parses a specifier following a '%'(i.e. "n", "(w)n", "(.p)n" or "(w.p)n").
+		// Numbers may have several digits, and 'w' and 'p' may be '*' for kFromArgument.
+		// Advances 'itr' past it on success and leaves it untouched on failure.
+		bool parse_spec(const char *& itr, format_spec& spec);
+		// Reads the digits at 'p' into 'value'. Fails if there are none or the number is
+		// above format_spec::kMaxNumber.
+		bool parse_spec_number(const char *& p, int& value);
+
+		// Width/precision arguments collected so far for a "%(*.*)n" specifier.
+		struct pending_spec
+		{
+			pending_spec() : count(0) {}
+
+			int count;
+			int values[2];
+		};
+		// Converts a width/precision argument to int. Only integers are accepted.
+		// Values are clamped to [0, format_spec::kMaxNumber], the range the parser accepts.
+		template <typename T>
+		int spec_value(T value);
+		inline int spec_value(int64_t value) { return static_cast<int>(std::min<int64_t>(std::max<int64_t>(value, 0), format_spec::kMaxNumber)); }
+		inline int spec_value(int32_t value) { return spec_value(static_cast<int64_t>(value)); }
+		inline int spec_value(uint32_t value) { return spec_value(static_cast<int64_t>(value)); }
+		inline int spec_value(uint64_t value) { return static_cast<int>(std::min<uint64_t>(value, format_spec::kMaxNumber)); }
+
+		// A type-erased reference to a format argument, used by compiled formats.
+		template <typename String>
+		struct arg_ref
+		{
+			const void *value;
+			int (*render)(String& wstr, int currentLength, const void *value, int width, int precision);
+			int (*spec_value)(const void *value);
+		};
+		template <typename String, typename T>
+		int render_arg(String& wstr, int currentLength, const void *value, int width, int precision);
+		template <typename T>
+		int spec_value_arg(const void *value);
+		template <typename String, typename T>
+		arg_ref<String> make_arg_ref(const T& value);
+
+		// Sizing helpers: the exact number of characters render() writes for a value with no width.
+		int width_of(int64_t value);
+		int width_of(uint64_t value);
+		int width_of(double value, int precision);
+		int width_of(timestamp value, int precision);
+
+		const int kRegistryBuckets = 1024;
+		struct registry_node
+		{
+			registry_node(const char *formatText, uint32_t hash) : format(formatText), hash(hash), next(nullptr) {}
+
+			compiled_format format;
+			uint32_t hash;
+			registry_node *next;
+		};
+		std::atomic<registry_node *> *registry_buckets();
+		uint32_t hash(const char *str);
 	}
 }
 
 
 template<typename String,typename T>
-int miniformat::ApplyToFormatStr(String& outputText, const char*& itr,T p1)
+int miniformat::ApplyToFormatStr(String& outputText, int currentLength, const char*& itr, detail::pending_spec& pending,T p1)
 {
 	char c = 0;
-	int currentLength=0;
+	format_spec spec;
 	while((c=*itr++))
 	{
 		if(c == '%')
 		{
+			const char *specBegin = itr-1;
 			if(*itr == '%')										/* "%%" */ 
 			{
 				currentLength = string_adaptor::append(outputText, currentLength, 1, '%');
 				++itr;
 			}
-			else if(*itr >= '0' && *itr <= '9')					/* "%n" */
+			else if((*itr >= '0' && *itr <= '9') &&
+				!(*(itr+1) >= '0' && *(itr+1) <= '9'))			/* "%n" */
 			{
-				detail::render(outputText, currentLength, p1, 0, 6);
+				currentLength = detail::render(outputText, currentLength, p1, 0, 6);
 				++itr;
 				return currentLength;
 			}
 			else if(*itr == '(' &&
 				(*(itr+1) >= '0' && *(itr+1) <= '9') &&
 				*(itr+2) == ')' &&
-				(*(itr+3) >= '0' && *(itr+3) <= '9'))			/* %(w)n */
+				(*(itr+3) >= '0' && *(itr+3) <= '9') &&
+				!(*(itr+4) >= '0' && *(itr+4) <= '9'))			/* %(w)n */
 			{
-				detail::render(outputText, currentLength, p1, *(itr+1)-'0', 6); 
+				currentLength = detail::render(outputText, currentLength, p1, *(itr+1)-'0', 6);
 				itr += 4;
 				return currentLength;
 			}
@@ -231,9 +630,10 @@ int miniformat::ApplyToFormatStr(String& outputText, const char*& itr,T p1)
 				*(itr+1) == '.' &&
 				(*(itr+2) >= '0' && *(itr+2) <= '9') &&
 				*(itr+3) == ')' &&
-				(*(itr+4) >= '0' && *(itr+4) <= '9'))			/* "%(.p)n" */
+				(*(itr+4) >= '0' && *(itr+4) <= '9') &&
+				!(*(itr+5) >= '0' && *(itr+5) <= '9'))			/* "%(.p)n" */
 			{
-				detail::render(outputText, currentLength, p1, 0, *(itr+2)-'0');
+				currentLength = detail::render(outputText, currentLength, p1, 0, *(itr+2)-'0');
 				itr += 5;
 				return currentLength;
 
@@ -243,12 +643,32 @@ int miniformat::ApplyToFormatStr(String& outputText, const char*& itr,T p1)
 				*(itr+2) == '.' &&
 				(*(itr+3) >= '0' && *(itr+3) <= '9') &&
 				*(itr+4) == ')' &&
-				(*(itr+5) >= '0' && *(itr+5) <= '9'))			/* %(w.p)n */
+				(*(itr+5) >= '0' && *(itr+5) <= '9') &&
+				!(*(itr+6) >= '0' && *(itr+6) <= '9'))			/* %(w.p)n */
 			{
-				detail::render(outputText, currentLength, p1, *(itr+1)-'0', *(itr+3)-'0'); 
+				currentLength = detail::render(outputText, currentLength, p1, *(itr+1)-'0', *(itr+3)-'0');
 				itr += 6;
 				return currentLength;
 			}
+			else if(detail::parse_spec(itr, spec))				/* multi-digit or "*" */
+			{
+				const int needed = (spec.width == format_spec::kFromArgument) + (spec.precision == format_spec::kFromArgument);
+				if(pending.count < needed)
+				{
+					// p1 is a width/precision. Come back to this specifier with the next argument.
+					pending.values[pending.count++] = detail::spec_value(p1);
+					itr = specBegin;
+					return currentLength;
+				}
+				int next = 0;
+				if(spec.width == format_spec::kFromArgument)
+					spec.width = pending.values[next++];
+				if(spec.precision == format_spec::kFromArgument)
+					spec.precision = pending.values[next++];
+				pending.count = 0;
+				currentLength = detail::render(outputText, currentLength, p1, spec.width, spec.precision);
+				return currentLength;
+			}
 			else
 			{
 				currentLength = string_adaptor::append(outputText, currentLength, 1, c);
@@ -262,19 +682,24 @@ int miniformat::ApplyToFormatStr(String& outputText, const char*& itr,T p1)
 	}
 	return currentLength;
 }
-template<typename... TS>
-void miniformat::format_va(TS... args)
+template<typename String>
+int miniformat::format_va(String& outputText, int currentLength, const char*& formatText, detail::pending_spec&)
 {
-
+	return currentLength;
 }
 
 
 template<typename String,typename T,typename... TS>
-void miniformat::format_va(String& outputText, const char*& formatText,T p1,TS... args)
+int miniformat::format_va(String& outputText, int currentLength, const char*& formatText, detail::pending_spec& pending,T p1,TS... args)
 {
 	//ȡ1formatText,Ҫʽĵطʹøòʽ
-	int offset=ApplyToFormatStr(outputText,formatText,p1);
-	format_va(outputText,formatText,args...);
+	currentLength=ApplyToFormatStr(outputText,currentLength,formatText,pending,p1);
+	return format_va(outputText,currentLength,formatText,pending,args...);
+}
+
+inline size_t calc_enouth_size_impl()
+{
+	return 0;
 }
 
 template<typename T>
@@ -300,20 +725,397 @@ size_t calc_enouth_size(const char *formatText,TS... args)
 template<typename String,typename... TS>
 void miniformat::format(String& outputText, const char *formatText,TS... args)
 {
+#ifdef MINIFORMAT_ENABLE_STATS
+	const char *statsKey = formatText;
+	stats::sample_timer timer;
+#endif
 	//size_t len1=strlen(formatText);
-	outputText="";
+	string_adaptor::clear(outputText);
 	size_t sz=calc_enouth_size(formatText,args...);
 	string_adaptor::reserve(outputText, sz);
 
-	format_va(outputText,formatText,args...);
-	size_t len2=strlen(formatText);
-	if(len2>0)
-		string_adaptor::append(outputText, len2, formatText);
+	detail::pending_spec pending;
+	int currentLength=format_va(outputText,0,formatText,pending,args...);
+	if(*formatText)
+		string_adaptor::append(outputText, currentLength, formatText);
 
+#ifdef MINIFORMAT_ENABLE_STATS
+	stats::record(statsKey, sz, string_adaptor::length(outputText), timer.elapsed());
+#endif
+}
+
+template<typename String,typename... TS>
+void miniformat::format(String& outputText, const compiled_format& formatText,TS... args)
+{
+#ifdef MINIFORMAT_ENABLE_STATS
+	stats::sample_timer timer;
+#endif
+	// The extra element keeps the array non-empty when there are no arguments.
+	const detail::arg_ref<String> argRefs[] = { detail::make_arg_ref<String>(args)..., detail::arg_ref<String>() };
+	const int argCount = sizeof...(args);
+
+	string_adaptor::clear(outputText);
+	size_t sz=formatText.literal_length()+calc_enouth_size_impl(args...);
+	string_adaptor::reserve(outputText, sz);
+
+	int currentLength=0;
+	const std::vector<compiled_format::segment>& segments = formatText.segments();
+	for(size_t i = 0; i < segments.size(); ++i)
+	{
+		const compiled_format::segment& seg = segments[i];
+		if(seg.literalLength > 0)
+			currentLength = string_adaptor::append(outputText, currentLength, formatText.literals()+seg.literalBegin, seg.literalLength);
+
+		const format_spec& spec = seg.spec;
+		if(spec.index >= 0 && spec.index < argCount)
+		{
+			int width = spec.width;
+			int precision = spec.precision;
+			if(seg.widthIndex >= 0)
+				width = argRefs[seg.widthIndex].spec_value(argRefs[seg.widthIndex].value);
+			if(seg.precisionIndex >= 0)
+				precision = argRefs[seg.precisionIndex].spec_value(argRefs[seg.precisionIndex].value);
+			currentLength = argRefs[spec.index].render(outputText, currentLength, argRefs[spec.index].value, width, precision);
+		}
+	}
+
+#ifdef MINIFORMAT_ENABLE_STATS
+	stats::record(formatText.text(), sz, string_adaptor::length(outputText), timer.elapsed());
+#endif
 }
 
 //[[[end]]]
 
+inline miniformat::compiled_format::compiled_format(const char *formatText)
+	: text_(formatText), argumentCount_(0), valid_(true)
+{
+	segment seg = { 0, 0, { -1, 0, 0 }, -1, -1 };
+	const char *itr = formatText;
+	char c = 0;
+	while((c=*itr++))
+	{
+		if(c == '%')
+		{
+			if(*itr == '%')										/* "%%" */
+			{
+				literals_ += '%';
+				++itr;
+				continue;
+			}
+			if(detail::parse_spec(itr, seg.spec) &&
+				seg.spec.index >= (seg.spec.width == format_spec::kFromArgument) + (seg.spec.precision == format_spec::kFromArgument))
+			{
+				seg.literalLength = static_cast<int>(literals_.length()) - seg.literalBegin;
+				// As in printf, the precision comes right before the value and the width before that.
+				int dynamic = seg.spec.index;
+				seg.precisionIndex = seg.spec.precision == format_spec::kFromArgument ? --dynamic : -1;
+				seg.widthIndex = seg.spec.width == format_spec::kFromArgument ? --dynamic : -1;
+				segments_.push_back(seg);
+				argumentCount_ = std::max(argumentCount_, seg.spec.index+1);
+				seg.literalBegin = static_cast<int>(literals_.length());
+				seg.spec.index = -1;
+				seg.widthIndex = seg.precisionIndex = -1;
+				continue;
+			}
+			// No assert here: interned formats come from data, e.g. message catalogs.
+			valid_ = false;
+		}
+		literals_ += c;
+	}
+	seg.literalLength = static_cast<int>(literals_.length()) - seg.literalBegin;
+	segments_.push_back(seg);
+}
+
+inline const miniformat::compiled_format& miniformat::intern(const char *formatText)
+{
+	using detail::registry_node;
+
+	const uint32_t h = detail::hash(formatText);
+	std::atomic<registry_node *>& head = detail::registry_buckets()[h % detail::kRegistryBuckets];
+
+	// Nodes are only ever pushed at the front, so a list once read stays valid.
+	registry_node *first = head.load(std::memory_order_acquire);
+	for(registry_node *n = first; n; n = n->next)
+	{
+		if(n->hash == h && strcmp(n->format.text(), formatText) == 0)
+			return n->format;
+	}
+
+	registry_node *created = new registry_node(formatText, h);
+	for(;;)
+	{
+		registry_node *checked = first;
+		created->next = first;
+		if(head.compare_exchange_weak(first, created, std::memory_order_release, std::memory_order_acquire))
+			return created->format;
+
+		// Someone else got in first. See whether they added the same format.
+		for(registry_node *n = first; n != checked; n = n->next)
+		{
+			if(n->hash == h && strcmp(n->format.text(), formatText) == 0)
+			{
+				delete created;
+				return n->format;
+			}
+		}
+	}
+}
+
+inline std::atomic<miniformat::detail::registry_node *> *miniformat::detail::registry_buckets()
+{
+	// Zero-initialized, as it has static storage duration.
+	static std::atomic<registry_node *> buckets[kRegistryBuckets];
+	return buckets;
+}
+
+// FNV-1a
+inline uint32_t miniformat::detail::hash(const char *str)
+{
+	uint32_t h = 2166136261u;
+	while(*str)
+	{
+		h ^= static_cast<unsigned char>(*str++);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+inline bool miniformat::detail::parse_spec(const char *& itr, format_spec& spec)
+{
+	const char *p = itr;
+	spec.width = 0;
+	spec.precision = 6;
+	if(*p == '(')
+	{
+		++p;
+		const char *optionBegin = p;
+		if(*p == '*')
+		{
+			spec.width = format_spec::kFromArgument;
+			++p;
+		}
+		else if(*p >= '0' && *p <= '9')
+		{
+			if(!parse_spec_number(p, spec.width))
+				return false;
+		}
+		if(*p == '.')
+		{
+			++p;
+			if(*p == '*')
+			{
+				spec.precision = format_spec::kFromArgument;
+				++p;
+			}
+			else if(!parse_spec_number(p, spec.precision))
+			{
+				return false;
+			}
+		}
+		if(p == optionBegin || *p != ')')
+			return false;
+		++p;
+	}
+	if(!parse_spec_number(p, spec.index))
+		return false;
+	itr = p;
+	return true;
+}
+
+inline bool miniformat::detail::parse_spec_number(const char *& p, int& value)
+{
+	if(!(*p >= '0' && *p <= '9'))
+		return false;
+	for(value = 0; *p >= '0' && *p <= '9'; ++p)
+	{
+		value = value*10 + (*p-'0');
+		if(value > format_spec::kMaxNumber)
+			return false;
+	}
+	return true;
+}
+
+template <typename String, typename T>
+int miniformat::detail::render_arg(String& wstr, int currentLength, const void *value, int width, int precision)
+{
+	return render(wstr, currentLength, *static_cast<const T *>(value), width, precision);
+}
+
+template <typename T>
+int miniformat::detail::spec_value_arg(const void *value)
+{
+	return spec_value(*static_cast<const T *>(value));
+}
+
+template <typename String, typename T>
+miniformat::detail::arg_ref<String> miniformat::detail::make_arg_ref(const T& value)
+{
+	arg_ref<String> ref = { &value, &render_arg<String, T>, &spec_value_arg<T> };
+	return ref;
+}
+
+template <typename T>
+int miniformat::detail::spec_value(T)
+{
+	assert(!"A width or precision argument must be an integer!");
+	return 0;
+}
+
+#ifdef MINIFORMAT_ENABLE_STATS
+inline std::mutex& miniformat::stats::registry_lock()
+{
+	static std::mutex m;
+	return m;
+}
+
+inline std::vector<miniformat::stats::thread_table *>& miniformat::stats::registry()
+{
+	static std::vector<thread_table *> tables;
+	return tables;
+}
+
+inline miniformat::stats::thread_table& miniformat::stats::local_table()
+{
+	static _FORMAT_THREAD_LOCAL thread_table *table = NULL;
+	if(!table)
+	{
+		table = new thread_table;
+		std::lock_guard<std::mutex> guard(registry_lock());
+		registry().push_back(table);
+	}
+	return *table;
+}
+
+inline miniformat::stats::sample_timer::sample_timer()
+{
+	static _FORMAT_THREAD_LOCAL int counter = 0;
+	sampled_ = (counter++ % kSampleInterval) == 0;
+	if(sampled_)
+		begin_ = std::chrono::steady_clock::now();
+}
+
+inline int64_t miniformat::stats::sample_timer::elapsed() const
+{
+	if(!sampled_)
+		return -1;
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin_).count();
+}
+
+inline void miniformat::stats::record(const char *formatText, size_t reserved, size_t length, int64_t nanoseconds)
+{
+	thread_table& t = local_table();
+	std::lock_guard<std::mutex> guard(t.lock);
+	entry& e = t.entries[formatText];
+	if(e.calls == 0)
+		e.formatText = formatText;
+	++e.calls;
+	e.bytes += length;
+	e.reservedBytes += reserved;
+	if(length > reserved)
+		++e.underReserved;
+	if(nanoseconds >= 0)
+	{
+		++e.sampledCalls;
+		e.sampledNanoseconds += nanoseconds;
+	}
+}
+
+inline std::map<const char *, miniformat::stats::entry> miniformat::stats::snapshot()
+{
+	std::map<const char *, entry> merged;
+	std::lock_guard<std::mutex> guard(registry_lock());
+	for(auto table = registry().begin(); table != registry().end(); ++table)
+	{
+		std::lock_guard<std::mutex> tableGuard((*table)->lock);
+		for(auto itr = (*table)->entries.begin(); itr != (*table)->entries.end(); ++itr)
+		{
+			const entry& from = itr->second;
+			entry& to = merged[itr->first];
+			if(to.calls == 0)
+				to.formatText = from.formatText;
+			to.calls += from.calls;
+			to.bytes += from.bytes;
+			to.reservedBytes += from.reservedBytes;
+			to.underReserved += from.underReserved;
+			to.sampledCalls += from.sampledCalls;
+			to.sampledNanoseconds += from.sampledNanoseconds;
+		}
+	}
+	return merged;
+}
+
+inline void miniformat::stats::reset()
+{
+	std::lock_guard<std::mutex> guard(registry_lock());
+	for(auto table = registry().begin(); table != registry().end(); ++table)
+	{
+		std::lock_guard<std::mutex> tableGuard((*table)->lock);
+		(*table)->entries.clear();
+	}
+}
+
+inline void miniformat::stats::report(FILE *fp)
+{
+	std::map<const char *, entry> entries = snapshot();
+	std::multimap<uint64_t, const entry *> sorted;
+	for(auto itr = entries.begin(); itr != entries.end(); ++itr)
+		sorted.insert(std::make_pair(itr->second.bytes, &itr->second));
+
+	fprintf(fp, "%10s %12s %8s %8s %8s %8s  %s\n", "calls", "bytes", "avg", "reserve", "under", "ns", "format");
+	for(auto itr = sorted.rbegin(); itr != sorted.rend(); ++itr)
+	{
+		const entry& e = *itr->second;
+		std::string text;
+		for(const char *c = e.formatText.c_str(); *c; ++c)
+		{
+			if(*c == '\n')
+				text += "\\n";
+			else
+				text += *c;
+		}
+		fprintf(fp, "%10llu %12llu %8llu %8llu %8llu %8llu  \"%s\"\n",
+			(unsigned long long)e.calls,
+			(unsigned long long)e.bytes,
+			(unsigned long long)(e.bytes / e.calls),
+			(unsigned long long)(e.reservedBytes / e.calls),
+			(unsigned long long)e.underReserved,
+			(unsigned long long)(e.sampledCalls ? e.sampledNanoseconds / e.sampledCalls : 0),
+			text.c_str());
+	}
+}
+#endif
+
+inline miniformat::timestamp miniformat::timestamp::now()
+{
+	return timestamp(std::chrono::duration_cast<std::chrono::microseconds>(
+		std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+template <typename Range>
+miniformat::join_view<typename Range::const_iterator> miniformat::join(const Range& range, const char *separator, const char *elementFormat)
+{
+	join_view<typename Range::const_iterator> view = { range.begin(), range.end(), separator, elementFormat };
+	return view;
+}
+
+template <typename T, int N>
+miniformat::join_view<const T *> miniformat::join(const T (&range)[N], const char *separator, const char *elementFormat)
+{
+	join_view<const T *> view = { range, range + N, separator, elementFormat };
+	return view;
+}
+
+template <typename Sink, int ChunkSize>
+void miniformat::chunked_output<Sink, ChunkSize>::flush()
+{
+	if(buffer_.empty())
+		return;
+	sink_(buffer_.data(), static_cast<int>(buffer_.length()));
+	flushed_ += static_cast<int>(buffer_.length() - base_);
+	base_ = 0;
+	buffer_.clear();
+}
+
 inline void miniformat::detail::strreverse(char *begin, char *end)
 {
 	char aux;
@@ -333,6 +1135,28 @@ inline int miniformat::detail::size_enough(const char *value)
     return strlen(value);
 }
 
+template <typename Iterator>
+int miniformat::detail::size_enough(const join_view<Iterator>& value)
+{
+    const size_t count = join_element_count(value.first, value.last, typename std::iterator_traits<Iterator>::iterator_category());
+    const size_t perElement = kGranulity + strlen(value.separator) + strlen(value.elementFormat);
+    if(count > kMaxJoinReservation / perElement)
+        return kMaxJoinReservation;
+    return static_cast<int>(count * perElement);
+}
+
+template <typename Iterator>
+size_t miniformat::detail::join_element_count(Iterator first, Iterator last, std::random_access_iterator_tag)
+{
+    return static_cast<size_t>(last - first);
+}
+
+template <typename Iterator, typename Category>
+size_t miniformat::detail::join_element_count(Iterator first, Iterator last, Category)
+{
+    return 0;
+}
+
 inline int miniformat::detail::digits10(uint32_t v)
 {
     static const uint32_t P01 = 10;
@@ -675,6 +1499,13 @@ int miniformat::detail::render(String& wstr, int currentLength, double value, in
 		/* if halfway, round up if odd, OR
 			if last digit is 0.  That last part is strange */
 		++frac;
+		/* handle rollover, e.g.  case 1.95 with precision 1 is 2.0.
+			With precision 0 the whole part is rounded half-even below */
+		if(precision > 0 && frac >= pow10[precision]) 
+		{
+			frac = 0;
+			++whole;
+		}
 	}
 
 	/* for very large numbers switch back to native sprintf for exponentials.
@@ -764,3 +1595,375 @@ int miniformat::detail::render(String& wstr, int currentLength, const char *valu
 
     return currentLength;
 }
+
+inline const char *miniformat::detail::timestamp_prefix(int64_t minutes)
+{
+    static const char digits[201] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+
+    static _FORMAT_THREAD_LOCAL int64_t cachedMinutes = INT64_MIN;
+    static _FORMAT_THREAD_LOCAL char cachedPrefix[17];
+
+    if(minutes == cachedMinutes)
+        return cachedPrefix;
+
+    int64_t days = minutes / 1440;
+    int minuteOfDay = static_cast<int>(minutes - days*1440);
+    if(minuteOfDay < 0)
+    {
+        --days;
+        minuteOfDay += 1440;
+    }
+
+    // Civil date from days since the epoch(proleptic Gregorian calendar).
+    // See http://howardhinnant.github.io/date_algorithms.html
+    days += 719468;
+    const int64_t era = (days >= 0 ? days : days - 146096) / 146097;
+    const uint32_t doe = static_cast<uint32_t>(days - era * 146097);
+    const uint32_t yoe = (doe - doe/1460 + doe/36524 - doe/146096) / 365;
+    const uint32_t doy = doe - (365*yoe + yoe/4 - yoe/100);
+    const uint32_t mp = (5*doy + 2)/153;
+    const uint32_t day = doy - (153*mp + 2)/5 + 1;
+    const uint32_t month = mp < 10 ? mp + 3 : mp - 9;
+    const uint32_t year = static_cast<uint32_t>(yoe + era * 400 + (month <= 2)) % 10000;
+
+    char *p = cachedPrefix;
+    memcpy(p + 0, digits + (year / 100) * 2, 2);
+    memcpy(p + 2, digits + (year % 100) * 2, 2);
+    p[4] = '-';
+    memcpy(p + 5, digits + month * 2, 2);
+    p[7] = '-';
+    memcpy(p + 8, digits + day * 2, 2);
+    p[10] = 'T';
+    memcpy(p + 11, digits + (minuteOfDay / 60) * 2, 2);
+    p[13] = ':';
+    memcpy(p + 14, digits + (minuteOfDay % 60) * 2, 2);
+    p[16] = ':';
+
+    cachedMinutes = minutes;
+    return cachedPrefix;
+}
+
+template <typename String>
+int miniformat::detail::render(String& wstr, int currentLength, timestamp value, int width, int precision)
+{
+    static const char digits[201] =
+        "0001020304050607080910111213141516171819"
+        "2021222324252627282930313233343536373839"
+        "4041424344454647484950515253545556575859"
+        "6061626364656667686970717273747576777879"
+        "8081828384858687888990919293949596979899";
+    static const uint32_t divisors[] = { 1000000, 100000, 10000, 1000, 100, 10, 1 };
+
+    if(precision < 0)
+        precision = 0;
+    else if(precision > 6)
+        precision = 6;
+
+    // Split into whole seconds and microseconds, rounding toward negative infinity.
+    int64_t seconds = value.microseconds / 1000000;
+    int32_t usec = static_cast<int32_t>(value.microseconds - seconds*1000000);
+    if(usec < 0)
+    {
+        --seconds;
+        usec += 1000000;
+    }
+    int64_t minutes = seconds / 60;
+    int32_t second = static_cast<int32_t>(seconds - minutes*60);
+    if(second < 0)
+    {
+        --minutes;
+        second += 60;
+    }
+
+    // "YYYY-MM-DDTHH:MM:SS" + ".fff..." + "Z"
+    const int length = 19 + (precision > 0 ? precision + 1 : 0) + 1;
+
+	// Handle the 'width' parameter.
+	int spaceCnt = width - length;
+	if(spaceCnt > 0)
+		currentLength = string_adaptor::append(wstr, currentLength, spaceCnt, ' ');
+
+    int next = currentLength;
+    currentLength = string_adaptor::append(wstr, currentLength, length, '0');
+
+    char *p = string_adaptor::at(wstr, next);
+    memcpy(p, timestamp_prefix(minutes), 17);
+    memcpy(p + 17, digits + second * 2, 2);
+    p[length-1] = 'Z';
+
+    if(precision > 0)
+    {
+        p[19] = '.';
+        uint32_t frac = static_cast<uint32_t>(usec) / divisors[precision];
+        char *last = p + 19 + precision;
+        while(frac >= 100)
+        {
+            const uint32_t i = (frac % 100) * 2;
+            frac /= 100;
+            last[0] = digits[i+1];
+            last[-1] = digits[i];
+            last -= 2;
+        }
+        // Handle last 1-2 digits. The leading zeros are already in place.
+        if(frac < 10)
+        {
+            last[0] = '0'+static_cast<char>(frac);
+        }
+        else
+        {
+            const uint32_t i = frac * 2;
+            last[0] = digits[i+1];
+            last[-1] = digits[i];
+        }
+    }
+
+    return currentLength;
+}
+
+template <typename String, typename Iterator>
+int miniformat::detail::render(String& wstr, int currentLength, const join_view<Iterator>& value, int /*width*/, int /*precision*/)
+{
+	for(Iterator itr = value.first; itr != value.last; ++itr)
+	{
+		if(itr != value.first)
+			currentLength = string_adaptor::append(wstr, currentLength, value.separator);
+
+		const char *formatText = value.elementFormat;
+		pending_spec pending;
+		currentLength = ApplyToFormatStr(wstr, currentLength, formatText, pending, *itr);
+		if(*formatText)
+			currentLength = string_adaptor::append(wstr, currentLength, formatText);
+
+		string_adaptor::checkpoint(wstr);
+	}
+	return currentLength;
+}
+
+template <typename... TS>
+miniformat::table& miniformat::table::row(TS... cells)
+{
+	// Expands add_cell() for every cell, in order.
+	int expand[] = { 0, (add_cell(cells), 0)... };
+	(void)expand;
+	ensure_column(static_cast<int>(sizeof...(cells)) - 1);
+	rowEnds_.push_back(static_cast<int>(cells_.size()));
+	return *this;
+}
+
+inline miniformat::table& miniformat::table::left(int column)
+{
+	ensure_column(column);
+	lefts_[column] = 1;
+	return *this;
+}
+
+inline miniformat::table& miniformat::table::precision(int column, int precision)
+{
+	ensure_column(column);
+	precisions_[column] = precision;
+	return *this;
+}
+
+inline void miniformat::table::ensure_column(int column)
+{
+	if(column < columns_)
+		return;
+	columns_ = column + 1;
+	precisions_.resize(columns_, 6);
+	lefts_.resize(columns_, 0);
+}
+
+inline void miniformat::table::add_cell(int64_t value)
+{
+	cell c;
+	c.type = cell::kInt;
+	c.value.i = value;
+	c.length = 0;
+	cells_.push_back(c);
+}
+
+inline void miniformat::table::add_cell(uint64_t value)
+{
+	cell c;
+	c.type = cell::kUInt;
+	c.value.u = value;
+	c.length = 0;
+	cells_.push_back(c);
+}
+
+inline void miniformat::table::add_cell(double value)
+{
+	cell c;
+	c.type = cell::kDouble;
+	c.value.d = value;
+	c.length = 0;
+	cells_.push_back(c);
+}
+
+inline void miniformat::table::add_cell(const char *value)
+{
+	cell c;
+	c.type = cell::kString;
+	c.value.textBegin = static_cast<int>(text_.length());
+	c.length = static_cast<int>(strlen(value));
+	text_.append(value, c.length);
+	cells_.push_back(c);
+}
+
+inline void miniformat::table::add_cell(timestamp value)
+{
+	cell c;
+	c.type = cell::kTimestamp;
+	c.value.i = value.microseconds;
+	c.length = 0;
+	cells_.push_back(c);
+}
+
+inline int miniformat::table::width_of(const cell& c, int column) const
+{
+	switch(c.type)
+	{
+	case cell::kInt:		return detail::width_of(c.value.i);
+	case cell::kUInt:		return detail::width_of(c.value.u);
+	case cell::kDouble:		return detail::width_of(c.value.d, precisions_[column]);
+	case cell::kTimestamp:	return detail::width_of(timestamp(c.value.i), precisions_[column]);
+	default:				return c.length;
+	}
+}
+
+template <typename String>
+void miniformat::table::render(String& outputText) const
+{
+	// Sizing pass: the widest cell of each column, and the exact output size.
+	std::vector<int> widths(columns_, 0);
+	int row = 0;
+	for(int i = 0; i < static_cast<int>(cells_.size()); ++i)
+	{
+		while(i >= rowEnds_[row])
+			++row;
+		const int column = i - (row > 0 ? rowEnds_[row-1] : 0);
+		widths[column] = std::max(widths[column], width_of(cells_[i], column));
+	}
+	const int separatorLength = static_cast<int>(strlen(separator_));
+	int lineLength = 1;
+	for(int column = 0; column < columns_; ++column)
+		lineLength += widths[column] + (column > 0 ? separatorLength : 0);
+
+	string_adaptor::clear(outputText);
+	string_adaptor::reserve(outputText, lineLength * row_count());
+
+	// Rendering pass.
+	int currentLength = 0;
+	int begin = 0;
+	for(row = 0; row < row_count(); ++row)
+	{
+		const int end = rowEnds_[row];
+		for(int i = begin; i < end; ++i)
+		{
+			const int column = i - begin;
+			const cell& c = cells_[i];
+			if(column > 0)
+				currentLength = string_adaptor::append(outputText, currentLength, separator_, separatorLength);
+
+			const int lineStart = currentLength;
+			const int width = lefts_[column] ? 0 : widths[column];
+			switch(c.type)
+			{
+			case cell::kInt:
+				currentLength = detail::render(outputText, currentLength, c.value.i, width, 0);
+				break;
+			case cell::kUInt:
+				currentLength = detail::render(outputText, currentLength, c.value.u, width, 0);
+				break;
+			case cell::kDouble:
+				currentLength = detail::render(outputText, currentLength, c.value.d, width, precisions_[column]);
+				break;
+			case cell::kTimestamp:
+				currentLength = detail::render(outputText, currentLength, timestamp(c.value.i), width, precisions_[column]);
+				break;
+			default:
+				if(width > c.length)
+					currentLength = string_adaptor::append(outputText, currentLength, width - c.length, ' ');
+				currentLength = string_adaptor::append(outputText, currentLength, text_.data() + c.value.textBegin, c.length);
+				break;
+			}
+
+			// Left-aligned cells are padded after the text, except at the end of the line.
+			const int padding = widths[column] - (currentLength - lineStart);
+			if(lefts_[column] && padding > 0 && i+1 < end)
+				currentLength = string_adaptor::append(outputText, currentLength, padding, ' ');
+		}
+		currentLength = string_adaptor::append(outputText, currentLength, 1, '\n');
+		begin = end;
+	}
+}
+
+inline int miniformat::detail::width_of(int64_t value)
+{
+	return value < 0 ? 1 + digits10(0 - static_cast<uint64_t>(value)) : digits10(static_cast<uint64_t>(value));
+}
+
+inline int miniformat::detail::width_of(uint64_t value)
+{
+	return digits10(value);
+}
+
+inline int miniformat::detail::width_of(double value, int precision)
+{
+	// Follows the rounding in render(double).
+	if(!(value == value))
+		return 3;
+
+	if(precision < 0)
+		precision = 0;
+	else if(precision > 9)
+		precision = 9;
+
+	if(value > (double)(0x7FFFFFFF) || value < -(double)(0x7FFFFFFF))
+	{
+		// Exponential notation. Rare enough to simply measure.
+		const int kSomeEnoughSpace = 128;
+		char buffer[kSomeEnoughSpace+1];
+#if _MSC_VER
+		return sprintf_s(buffer, kSomeEnoughSpace, "%e", value);
+#else
+		return snprintf(buffer, kSomeEnoughSpace, "%e", value);
+#endif
+	}
+
+	const int neg = value < 0;
+	if(neg)
+		value = -value;
+
+	int whole = (int)value;
+	if(precision == 0)
+	{
+		const double diff = value - whole;
+		if(diff > 0.5 || (diff == 0.5 && (whole & 1)))
+			++whole;
+	}
+	else
+	{
+		const double tmp = (value - whole) * pow10[precision];
+		const uint32_t frac = (uint32_t)(tmp);
+		const double diff = tmp - frac;
+		if((diff > 0.5 || (diff == 0.5 && ((frac == 0) || (frac & 1)))) && frac + 1 >= pow10[precision])
+			++whole;
+	}
+	return neg + digits10(static_cast<uint32_t>(whole)) + (precision > 0 ? precision + 1 : 0);
+}
+
+inline int miniformat::detail::width_of(timestamp, int precision)
+{
+	if(precision < 0)
+		precision = 0;
+	else if(precision > 6)
+		precision = 6;
+	// "YYYY-MM-DDTHH:MM:SS" + ".fff..." + "Z"
+	return 19 + (precision > 0 ? precision + 1 : 0) + 1;
+}
@@ -0,0 +1,354 @@
+// profile_render.cpp : Hardware-counter profile of the render kernels and of the full format path.
+// Runs each miniformat::detail::render overload and mini::format over several value distributions
+// and writes one CSV line per(kernel, distribution) with the time, cycles, instructions,
+// branch misses and cache misses per operation.
+// Counters come from perf_event_open and are only available on Linux(see perf_event_paranoid).
+// Without them the counter columns are left empty and only the time is reported.
+// Not part of test_tinyformat; build it on its own with optimizations on, e.g.
+//    g++ -O2 -std=c++11 profile_render.cpp -o profile_render
+// Usage: profile_render [-n iterations] [-d uniform|small|log|all] [-o output.csv]
+//
+
+#include "miniformat_va.h"
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <limits>
+#include <random>
+#include <string>
+#include <vector>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+	volatile size_t g_sink;	// Keeps the optimizer from dropping the work.
+
+	const int kValueCount = 4096;	// Values are generated up front and cycled through.
+
+	// cycles, instructions, branch-misses, cache-misses
+	const int kCounterCount = 4;
+	const char *kCounterNames[kCounterCount] = { "cycles", "instructions", "branch_misses", "cache_misses" };
+
+	class perf_counters
+	{
+	public:
+		perf_counters();
+		~perf_counters();
+
+		bool available() const { return fds_[0] >= 0; }
+		void start();
+		// Fills 'values' with the counts since start(), scaled for multiplexing.
+		void stop(double values[kCounterCount]);
+
+	private:
+		int fds_[kCounterCount];
+	};
+
+	enum distribution
+	{
+		kUniform,		// Uniform over the whole range of the type
+		kSmallHeavy,	// Mostly small values, as in counters and sizes
+		kLogUniform,	// Uniform number of digits
+		kDistributionCount
+	};
+	const char *kDistributionNames[kDistributionCount] = { "uniform", "small", "log" };
+
+	struct result
+	{
+		double nanoseconds;
+		double counters[kCounterCount];
+		bool hasCounters;
+	};
+
+	// Runs 'op' on every value in turn, 'iterations' times in total.
+	template <typename T, typename Op>
+	result profile(perf_counters& perf, const std::vector<T>& values, int iterations, Op op)
+	{
+		for(int i = 0; i < kValueCount; ++i)	// Warm up
+			op(values[i]);
+
+		result r;
+		perf.start();
+		std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+		for(int i = 0; i < iterations; ++i)
+			op(values[i & (kValueCount-1)]);
+		std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+		perf.stop(r.counters);
+
+		r.hasCounters = perf.available();
+		r.nanoseconds = std::chrono::duration<double, std::nano>(end - begin).count();
+		return r;
+	}
+
+	void write_result(FILE *fp, const char *kernel, distribution d, int iterations, const result& r)
+	{
+		fprintf(fp, "%s,%s,%d,%.3f", kernel, kDistributionNames[d], iterations, r.nanoseconds / iterations);
+		for(int i = 0; i < kCounterCount; ++i)
+		{
+			if(r.hasCounters)
+				fprintf(fp, ",%.3f", r.counters[i] / iterations);
+			else
+				fprintf(fp, ",");
+		}
+		fprintf(fp, "\n");
+		fflush(fp);
+	}
+
+	// Magnitudes for the integer and double kernels.
+	double make_magnitude(distribution d, double maxValue, std::mt19937_64& rng)
+	{
+		switch(d)
+		{
+		case kUniform:
+			return std::uniform_real_distribution<double>(0, maxValue)(rng);
+		case kSmallHeavy:
+			// 90% below 100, the rest below 100000.
+			return std::uniform_real_distribution<double>(0, std::min(rng() % 10 ? 100.0 : 100000.0, maxValue))(rng);
+		default:
+			return std::pow(10.0, std::uniform_real_distribution<double>(0, std::log10(maxValue))(rng));
+		}
+	}
+
+	template <typename T>
+	std::vector<T> make_integers(distribution d, std::mt19937_64& rng)
+	{
+		const bool isSigned = T(-1) < T(0);
+		const double maxValue = static_cast<double>(std::numeric_limits<T>::max()) * 0.999;
+		std::vector<T> values(kValueCount);
+		for(int i = 0; i < kValueCount; ++i)
+		{
+			T v = static_cast<T>(make_magnitude(d, maxValue, rng));
+			if(isSigned && (rng() & 1))
+				v = T(0) - v;
+			values[i] = v;
+		}
+		return values;
+	}
+
+	std::vector<double> make_doubles(distribution d, std::mt19937_64& rng)
+	{
+		std::vector<double> values(kValueCount);
+		for(int i = 0; i < kValueCount; ++i)
+		{
+			double v = make_magnitude(d, 1e9, rng);
+			values[i] = (rng() & 1) ? -v : v;
+		}
+		return values;
+	}
+
+	// String lengths follow the distribution.
+	std::vector<const char *> make_strings(distribution d, std::mt19937_64& rng, std::vector<std::string>& storage)
+	{
+		storage.resize(kValueCount);
+		std::vector<const char *> values(kValueCount);
+		for(int i = 0; i < kValueCount; ++i)
+		{
+			storage[i].assign(static_cast<size_t>(make_magnitude(d, 256, rng)), 'a' + static_cast<char>(i % 26));
+			values[i] = storage[i].c_str();
+		}
+		return values;
+	}
+
+	// Uniform jumps around a day, small steps(the usual log case) or steps of any magnitude.
+	std::vector<mini::timestamp> make_timestamps(distribution d, std::mt19937_64& rng)
+	{
+		std::vector<mini::timestamp> values;
+		int64_t t = 1369125015123456LL;
+		for(int i = 0; i < kValueCount; ++i)
+		{
+			if(d == kUniform)
+				values.push_back(mini::timestamp(t + static_cast<int64_t>(rng() % 86400000000ULL)));
+			else
+				values.push_back(mini::timestamp(t += static_cast<int64_t>(make_magnitude(d, 1e9, rng))));
+		}
+		return values;
+	}
+
+	template <typename T>
+	void profile_render(FILE *fp, perf_counters& perf, const char *kernel, distribution d, int iterations, const std::vector<T>& values)
+	{
+		std::string str;
+		str.reserve(256);
+		result r = profile(perf, values, iterations, [&str](const T& value) {
+			str.clear();
+			mini::detail::render(str, 0, value, 0, 6);
+			g_sink = str.length();
+		});
+		write_result(fp, kernel, d, iterations, r);
+	}
+}
+
+#if defined(__linux__)
+
+perf_counters::perf_counters()
+{
+	static const uint64_t configs[kCounterCount] = {
+		PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS, PERF_COUNT_HW_BRANCH_MISSES, PERF_COUNT_HW_CACHE_MISSES };
+
+	for(int i = 0; i < kCounterCount; ++i)
+	{
+		perf_event_attr attr;
+		memset(&attr, 0, sizeof(attr));
+		attr.size = sizeof(attr);
+		attr.type = PERF_TYPE_HARDWARE;
+		attr.config = configs[i];
+		attr.disabled = i == 0;
+		attr.exclude_kernel = 1;
+		attr.exclude_hv = 1;
+		attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+		fds_[i] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, i == 0 ? -1 : fds_[0], 0));
+		if(fds_[i] < 0)
+		{
+			// All or nothing: fall back to timing only.
+			for(int j = 0; j < i; ++j)
+				close(fds_[j]);
+			for(int j = 0; j < kCounterCount; ++j)
+				fds_[j] = -1;
+			return;
+		}
+	}
+}
+
+perf_counters::~perf_counters()
+{
+	for(int i = 0; i < kCounterCount; ++i)
+	{
+		if(fds_[i] >= 0)
+			close(fds_[i]);
+	}
+}
+
+void perf_counters::start()
+{
+	if(!available())
+		return;
+	ioctl(fds_[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+	ioctl(fds_[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+}
+
+void perf_counters::stop(double values[kCounterCount])
+{
+	for(int i = 0; i < kCounterCount; ++i)
+		values[i] = 0;
+	if(!available())
+		return;
+	ioctl(fds_[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+
+	// nr, time_enabled, time_running, values...
+	uint64_t data[3 + kCounterCount];
+	if(read(fds_[0], data, sizeof(data)) != static_cast<ssize_t>(sizeof(data)))
+		return;
+	const double scale = data[2] ? static_cast<double>(data[1]) / data[2] : 0;
+	for(int i = 0; i < kCounterCount; ++i)
+		values[i] = data[3 + i] * scale;
+}
+
+#else
+
+perf_counters::perf_counters()
+{
+	for(int i = 0; i < kCounterCount; ++i)
+		fds_[i] = -1;
+}
+
+perf_counters::~perf_counters() {}
+void perf_counters::start() {}
+
+void perf_counters::stop(double values[kCounterCount])
+{
+	for(int i = 0; i < kCounterCount; ++i)
+		values[i] = 0;
+}
+
+#endif
+
+int main(int argc, char *argv[])
+{
+	int iterations = 1000000;
+	int firstDistribution = 0, lastDistribution = kDistributionCount-1;
+	FILE *fp = stdout;
+	for(int i = 1; i+1 < argc; i += 2)
+	{
+		if(strcmp(argv[i], "-n") == 0)
+		{
+			iterations = atoi(argv[i+1]);
+		}
+		else if(strcmp(argv[i], "-d") == 0)
+		{
+			if(strcmp(argv[i+1], "all") == 0)
+			{
+				firstDistribution = 0;
+				lastDistribution = kDistributionCount-1;
+				continue;
+			}
+			int found = -1;
+			for(int d = 0; d < kDistributionCount; ++d)
+			{
+				if(strcmp(argv[i+1], kDistributionNames[d]) == 0)
+					found = d;
+			}
+			if(found < 0)
+			{
+				fprintf(stderr, "Unknown distribution %s; expected uniform, small, log or all\n", argv[i+1]);
+				return 1;
+			}
+			firstDistribution = lastDistribution = found;
+		}
+		else if(strcmp(argv[i], "-o") == 0)
+		{
+			fp = fopen(argv[i+1], "w");
+			if(!fp)
+			{
+				fprintf(stderr, "Can't open %s\n", argv[i+1]);
+				return 1;
+			}
+		}
+	}
+
+	perf_counters perf;
+	if(!perf.available())
+		fprintf(stderr, "Hardware counters are not available; reporting time only.\n");
+
+	fprintf(fp, "kernel,distribution,iterations,ns");
+	for(int i = 0; i < kCounterCount; ++i)
+		fprintf(fp, ",%s", kCounterNames[i]);
+	fprintf(fp, "\n");
+
+	std::mt19937_64 rng(20130521);
+	for(int i = firstDistribution; i <= lastDistribution; ++i)
+	{
+		const distribution d = static_cast<distribution>(i);
+		profile_render(fp, perf, "render_int32", d, iterations, make_integers<int32_t>(d, rng));
+		profile_render(fp, perf, "render_uint32", d, iterations, make_integers<uint32_t>(d, rng));
+		profile_render(fp, perf, "render_int64", d, iterations, make_integers<int64_t>(d, rng));
+		profile_render(fp, perf, "render_uint64", d, iterations, make_integers<uint64_t>(d, rng));
+		profile_render(fp, perf, "render_double", d, iterations, make_doubles(d, rng));
+		std::vector<std::string> storage;
+		const std::vector<const char *> strings = make_strings(d, rng, storage);
+		profile_render(fp, perf, "render_string", d, iterations, strings);
+		profile_render(fp, perf, "render_timestamp", d, iterations, make_timestamps(d, rng));
+
+		// The full path: specifier parsing, reservation and three kernels.
+		const std::vector<int32_t> ints = make_integers<int32_t>(d, rng);
+		const std::vector<double> doubles = make_doubles(d, rng);
+		std::vector<int> indices(kValueCount);
+		for(int j = 0; j < kValueCount; ++j)
+			indices[j] = j;
+		std::string str;
+		result r = profile(perf, indices, iterations, [&](int j) {
+			mini::format(str, "id=%0 value=%(.3)1 name=%2\n", ints[j], doubles[j], strings[j]);
+			g_sink = str.length();
+		});
+		write_result(fp, "format", d, iterations, r);
+	}
+
+	if(fp != stdout)
+		fclose(fp);
+	return 0;
+}